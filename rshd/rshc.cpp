@@ -0,0 +1,107 @@
+#include <sys/socket.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <poll.h>
+#include <iostream>
+#include "transport.h"
+
+using namespace std;
+
+#define BUFFER_SIZE 1000
+
+// Client for 'rshd <port> -z': relays stdin and stdout through the framed zlib transport,
+// see zlib_transport in transport.h for the wire format.
+// Usage: rshc <host> <port>
+
+int connect_socket(const char *host, const char *port) {
+    addrinfo hints;
+    memset(&hints, 0, sizeof(addrinfo));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *addrs;
+    if (getaddrinfo(host, port, &hints, &addrs) != 0) {
+        cerr << "failed to resolve " << host << endl;
+        return -1;
+    }
+    int sock = -1;
+    for (addrinfo *a = addrs; a != nullptr && sock == -1; a = a->ai_next) {
+        sock = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (sock != -1 && connect(sock, a->ai_addr, a->ai_addrlen) == -1) {
+            close(sock);
+            sock = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+    if (sock == -1) {
+        cerr << "failed to connect" << endl;
+    }
+    return sock;
+}
+
+bool write_all(int fd, string const &data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t res = write(fd, data.c_str() + written, data.size() - written);
+        if (res == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        written += res;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        cout << "Usage: " << argv[0] << " <host> <port>" << endl;
+        exit(EXIT_FAILURE);
+    }
+    int sock = connect_socket(argv[1], argv[2]);
+    if (sock == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    zlib_transport session_transport;
+    pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {sock, POLLIN, 0}};
+    char buffer[BUFFER_SIZE];
+    while (true) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[0].revents != 0) {
+            ssize_t bytes_read = read(STDIN_FILENO, buffer, BUFFER_SIZE);
+            if (bytes_read <= 0) {
+                shutdown(sock, SHUT_WR);
+                fds[0].fd = -1;
+            } else {
+                string out;
+                session_transport.encode(buffer, bytes_read, out);
+                if (!write_all(sock, out)) {
+                    break;
+                }
+            }
+        }
+        if (fds[1].revents != 0) {
+            ssize_t bytes_read = read(sock, buffer, BUFFER_SIZE);
+            if (bytes_read <= 0) {
+                break;
+            }
+            string out;
+            if (!session_transport.decode(buffer, bytes_read, out)) {
+                cerr << "malformed stream" << endl;
+                break;
+            }
+            if (!write_all(STDOUT_FILENO, out)) {
+                break;
+            }
+        }
+    }
+    close(sock);
+    session_transport.report(cerr);
+    return 0;
+}
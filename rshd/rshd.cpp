@@ -12,6 +12,9 @@
 #include <iostream>
 #include <vector>
 #include <wait.h>
+#include <sys/stat.h>
+#include <getopt.h>
+#include "transport.h"
 
 using namespace std;
 
@@ -34,6 +37,134 @@ enum class fd_type {
     listener, socket, terminal
 };
 
+struct cgroup_limits {
+    string root; // empty when sessions are not isolated
+    string cpu_weight;
+    string memory_max;
+    string pids_max;
+};
+
+bool write_file(string const &path, string const &value) {
+    int fd = open(path.c_str(), O_WRONLY);
+    if (fd == -1) {
+        return false;
+    }
+    bool res = write(fd, value.c_str(), value.size()) == (ssize_t) value.size();
+    close(fd);
+    return res;
+}
+
+// Reads a single value file, or the value of `key` in a flat keyed file like cpu.stat.
+long long read_cgroup_value(string const &path, string const &key) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    char buffer[BUFFER_SIZE];
+    ssize_t bytes_read = read(fd, buffer, BUFFER_SIZE - 1);
+    close(fd);
+    if (bytes_read <= 0) {
+        return -1;
+    }
+    buffer[bytes_read] = '\0';
+    const char *value = buffer;
+    if (!key.empty()) {
+        value = strstr(buffer, (key + " ").c_str());
+        if (value == nullptr) {
+            return -1;
+        }
+        value += key.size() + 1;
+    }
+    return atoll(value);
+}
+
+// Creates the parent cgroup of all sessions and delegates controllers to it.
+bool setup_cgroup_root(cgroup_limits const &limits) {
+    if (mkdir(limits.root.c_str(), 0755) == -1 && errno != EEXIST) {
+        cerr << "failed to create cgroup " << limits.root << endl;
+        return false;
+    }
+    string controllers[] = {"+cpu", "+memory", "+pids"};
+    for (auto const &controller : controllers) {
+        if (!write_file(limits.root + "/cgroup.subtree_control", controller)) {
+            cerr << "failed to enable " << controller << " in " << limits.root << endl;
+        }
+    }
+    return true;
+}
+
+// Leaves whose shells were still being killed when the session ended.
+vector<string> stale_cgroups;
+
+void remove_stale_cgroups() {
+    for (auto it = stale_cgroups.begin(); it != stale_cgroups.end();) {
+        if (rmdir(it->c_str()) == 0 || errno == ENOENT) {
+            it = stale_cgroups.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// cgroup v2 leaf holding the shell of one session.
+struct session_cgroup {
+    session_cgroup(cgroup_limits const &limits, int id) : owner(getpid()) {
+        if (limits.root.empty()) {
+            return;
+        }
+        // the daemon pid keeps leaves left over from a previous run from clashing with new ones
+        string leaf = limits.root + "/session-" + to_string(owner) + "-" + to_string(id);
+        if (mkdir(leaf.c_str(), 0755) == -1) {
+            cerr << "failed to create cgroup " << leaf << endl;
+            return;
+        }
+        path = leaf;
+        set_limit("cpu.weight", limits.cpu_weight);
+        set_limit("memory.max", limits.memory_max);
+        set_limit("pids.max", limits.pids_max);
+    }
+
+    // Forked shells drop their copies of other sessions, only the daemon may tear leaves down.
+    ~session_cgroup() {
+        if (!path.empty() && getpid() == owner) {
+            write_file(path + "/cgroup.kill", "1");
+            if (rmdir(path.c_str()) == -1) {
+                stale_cgroups.push_back(path);
+            }
+        }
+    }
+
+    // Called in the forked child before exec, the shell never runs outside of its leaf.
+    void enter() {
+        if (!path.empty() && !write_file(path + "/cgroup.procs", "0")) {
+            cerr << "failed to enter cgroup " << path << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    void report(ostream &os) const {
+        if (path.empty()) {
+            return;
+        }
+        os << "Session cgroup " << path
+           << ": cpu " << read_cgroup_value(path + "/cpu.stat", "usage_usec") << " us"
+           << ", memory " << read_cgroup_value(path + "/memory.current", "") << " bytes"
+           << ", memory peak " << read_cgroup_value(path + "/memory.peak", "") << " bytes"
+           << ", pids " << read_cgroup_value(path + "/pids.current", "") << endl;
+    }
+
+    string path;
+
+private:
+    pid_t owner;
+
+    void set_limit(string const &file, string const &value) {
+        if (!value.empty() && !write_file(path + "/" + file, value)) {
+            cerr << "failed to set " << file << " of " << path << endl;
+        }
+    }
+};
+
 struct fd_container {
     fd_container(int fd, fd_type type) :
             fd(fd),
@@ -51,6 +182,8 @@ struct fd_container {
     bool read_blocked;
     fd_type type;
     string write_queue;
+    shared_ptr<transport> session_transport;
+    shared_ptr<session_cgroup> session_group;
 
     int read_data() {
         char buffer[BUFFER_SIZE];
@@ -65,7 +198,11 @@ struct fd_container {
                 return 0;
             }
         } else {
-            other->write_queue.append(buffer, bytes_read);
+            if (type == fd_type::terminal) {
+                session_transport->encode(buffer, bytes_read, other->write_queue);
+            } else if (!session_transport->decode(buffer, bytes_read, other->write_queue)) {
+                return -1; //malformed stream
+            }
             int write_res = other->write_data();
             if (write_res == 0) {
                 read_blocked = true;
@@ -247,10 +384,40 @@ vector<shared_ptr<fd_container> > clients;
 vector<shared_ptr<fd_container> > terminals;
 
 int main(int argc, char **argv) {
-    if (argc < 2) {
+    bool compress = false;
+    cgroup_limits limits;
+    int opt;
+    while ((opt = getopt(argc, argv, "zg:c:m:p:")) != -1) {
+        switch (opt) {
+            case 'z':
+                compress = true;
+                break;
+            case 'g':
+                limits.root = optarg;
+                break;
+            case 'c':
+                limits.cpu_weight = optarg;
+                break;
+            case 'm':
+                limits.memory_max = optarg;
+                break;
+            case 'p':
+                limits.pids_max = optarg;
+                break;
+            default:
+                cout << "Usage: " << argv[0] << " <port> [-z] [-g cgroup [-c cpu.weight] [-m memory.max] [-p pids.max]]"
+                     << endl;
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (optind >= argc) {
         cout << "Need port to work." << endl;
         exit(errno);
     }
+    if (!limits.root.empty() && !setup_cgroup_root(limits)) {
+        exit(EXIT_FAILURE);
+    }
+    int sessions_num = 0;
 
     struct sigaction act;
     act.sa_flags = SA_SIGINFO;
@@ -263,7 +430,7 @@ int main(int argc, char **argv) {
 
     demonize();
 
-    uint16_t port = atoi(argv[1]);
+    uint16_t port = atoi(argv[optind]);
     auto listener = make_shared<fd_container>(create_listening_socket(port), fd_type::listener);
     int epoll_fd = create_epoll(&(*listener));
     raii_fd epoll_container(epoll_fd);
@@ -274,10 +441,27 @@ int main(int argc, char **argv) {
             auto *cont = (fd_container *) events[i].data.ptr;
             if (cont->type == fd_type::listener) {
                 cout << "New client connected." << endl;
+                remove_stale_cgroups();
+                auto session_group = make_shared<session_cgroup>(limits, ++sessions_num);
+                if (!limits.root.empty() && session_group->path.empty()) {
+                    cerr << "Client refused, no cgroup for its session" << endl;
+                    close(accept_socket(listener->fd.fd));
+                    continue;
+                }
                 clients.push_back(make_shared<fd_container>(accept_socket(listener->fd.fd), fd_type::socket));
                 terminals.push_back(make_shared<fd_container>(create_master_terminal(), fd_type::terminal));
                 clients.back()->other = &(*terminals.back());
                 terminals.back()->other = &(*clients.back());
+                shared_ptr<transport> session_transport;
+                if (compress) {
+                    session_transport = make_shared<zlib_transport>();
+                } else {
+                    session_transport = make_shared<raw_transport>();
+                }
+                clients.back()->session_transport = session_transport;
+                terminals.back()->session_transport = session_transport;
+                clients.back()->session_group = session_group;
+                terminals.back()->session_group = session_group;
                 add_to_epoll(epoll_fd, &(*clients.back()));
                 add_to_epoll(epoll_fd, &(*terminals.back()));
                 enable_nonblocking(clients.back()->fd.fd);
@@ -286,6 +470,7 @@ int main(int argc, char **argv) {
                 int slave = open(ptsname(terminals.back()->fd.fd), O_RDWR);
                 auto proc = fork();
                 if (!proc) {
+                    session_group->enter();
                     clients.clear();
                     terminals.clear();
                     listener.reset();
@@ -345,6 +530,8 @@ int main(int argc, char **argv) {
                 }
 
                 if (res == -1) {
+                    cont->session_transport->report(cerr);
+                    cont->session_group->report(cerr);
                     fd_container *term = cont->other;
                     if (term->type == fd_type::socket) {
                         swap(term, cont);
@@ -0,0 +1,185 @@
+#ifndef RSHD_TRANSPORT_H
+#define RSHD_TRANSPORT_H
+
+#include <memory.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <zlib.h>
+#include <iostream>
+#include <string>
+
+#define TRANSPORT_BUFFER_SIZE 1000
+#define MIN_COMPRESS_SIZE 64
+#define FRAME_HEADER_SIZE 5
+#define MAX_FRAME_SIZE (16 * TRANSPORT_BUFFER_SIZE)
+
+inline long long cpu_time_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct transport_stats {
+    transport_stats() : raw_out(0), wire_out(0), wire_in(0), raw_in(0), cpu_ns(0) {}
+
+    size_t raw_out; // local -> socket, before encoding
+    size_t wire_out; // local -> socket, after encoding
+    size_t wire_in; // socket -> local, before decoding
+    size_t raw_in; // socket -> local, after decoding
+    long long cpu_ns;
+};
+
+// Sits between a session's local side and its socket: encode() handles data going out to the peer,
+// decode() handles data coming from it. In rshd the local side is the terminal, in rshc the user's tty.
+struct transport {
+    virtual ~transport() {}
+
+    void encode(const char *data, size_t len, std::string &out) {
+        long long start = cpu_time_ns();
+        size_t before = out.size();
+        do_encode(data, len, out);
+        stats.raw_out += len;
+        stats.wire_out += out.size() - before;
+        stats.cpu_ns += cpu_time_ns() - start;
+    }
+
+    bool decode(const char *data, size_t len, std::string &out) {
+        long long start = cpu_time_ns();
+        size_t before = out.size();
+        bool res = do_decode(data, len, out);
+        stats.wire_in += len;
+        stats.raw_in += out.size() - before;
+        stats.cpu_ns += cpu_time_ns() - start;
+        return res;
+    }
+
+    void report(std::ostream &os) const {
+        os << "Session stats: out " << stats.raw_out << " -> " << stats.wire_out << " bytes";
+        if (stats.raw_out != 0) {
+            os << " (ratio " << (double) stats.wire_out / stats.raw_out << ")";
+        }
+        os << ", in " << stats.wire_in << " -> " << stats.raw_in << " bytes"
+           << ", transport cpu " << stats.cpu_ns / 1000 << " us" << std::endl;
+    }
+
+    transport_stats stats;
+
+protected:
+    virtual void do_encode(const char *data, size_t len, std::string &out) = 0;
+
+    virtual bool do_decode(const char *data, size_t len, std::string &out) = 0;
+};
+
+struct raw_transport : transport {
+protected:
+    void do_encode(const char *data, size_t len, std::string &out) override {
+        out.append(data, len);
+    }
+
+    bool do_decode(const char *data, size_t len, std::string &out) override {
+        out.append(data, len);
+        return true;
+    }
+};
+
+// Both directions are a sequence of frames: 1 byte kind ('R' raw or 'Z' deflate),
+// 4 bytes big-endian payload length, payload.
+// Each direction keeps its own deflate stream, flushed at every frame,
+// small interactive packets are sent raw. Frames over MAX_FRAME_SIZE are rejected.
+struct zlib_transport : transport {
+    zlib_transport() {
+        memset(&deflater, 0, sizeof(deflater));
+        memset(&inflater, 0, sizeof(inflater));
+        if (deflateInit(&deflater, Z_BEST_SPEED) != Z_OK || inflateInit(&inflater) != Z_OK) {
+            std::cout << "failed to init zlib" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    ~zlib_transport() override {
+        deflateEnd(&deflater);
+        inflateEnd(&inflater);
+    }
+
+protected:
+    void do_encode(const char *data, size_t len, std::string &out) override {
+        if (len < MIN_COMPRESS_SIZE) {
+            append_frame('R', data, len, out);
+            return;
+        }
+        std::string payload;
+        char buffer[TRANSPORT_BUFFER_SIZE];
+        deflater.next_in = (Bytef *) data;
+        deflater.avail_in = (uInt) len;
+        do {
+            deflater.next_out = (Bytef *) buffer;
+            deflater.avail_out = TRANSPORT_BUFFER_SIZE;
+            deflate(&deflater, Z_SYNC_FLUSH);
+            payload.append(buffer, TRANSPORT_BUFFER_SIZE - deflater.avail_out);
+        } while (deflater.avail_out == 0);
+        append_frame('Z', payload.c_str(), payload.size(), out);
+    }
+
+    bool do_decode(const char *data, size_t len, std::string &out) override {
+        pending.append(data, len);
+        size_t pos = 0;
+        while (pending.size() - pos >= FRAME_HEADER_SIZE) {
+            char kind = pending[pos];
+            uint32_t frame_len = 0;
+            for (int i = 1; i < FRAME_HEADER_SIZE; i++) {
+                frame_len = (frame_len << 8) | (unsigned char) pending[pos + i];
+            }
+            if (frame_len > MAX_FRAME_SIZE) {
+                return false;
+            }
+            if (pending.size() - pos - FRAME_HEADER_SIZE < frame_len) {
+                break;
+            }
+            const char *payload = pending.c_str() + pos + FRAME_HEADER_SIZE;
+            if (kind == 'R') {
+                out.append(payload, frame_len);
+            } else if (kind == 'Z') {
+                if (!inflate_frame(payload, frame_len, out)) {
+                    return false;
+                }
+            } else {
+                return false;
+            }
+            pos += FRAME_HEADER_SIZE + frame_len;
+        }
+        pending = pending.substr(pos);
+        return true;
+    }
+
+private:
+    void append_frame(char kind, const char *data, size_t len, std::string &out) {
+        out.push_back(kind);
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            out.push_back((char) ((len >> shift) & 0xff));
+        }
+        out.append(data, len);
+    }
+
+    bool inflate_frame(const char *data, size_t len, std::string &out) {
+        char buffer[TRANSPORT_BUFFER_SIZE];
+        inflater.next_in = (Bytef *) data;
+        inflater.avail_in = (uInt) len;
+        do {
+            inflater.next_out = (Bytef *) buffer;
+            inflater.avail_out = TRANSPORT_BUFFER_SIZE;
+            int res = inflate(&inflater, Z_SYNC_FLUSH);
+            if (res != Z_OK && res != Z_BUF_ERROR) {
+                return false;
+            }
+            out.append(buffer, TRANSPORT_BUFFER_SIZE - inflater.avail_out);
+        } while (inflater.avail_out == 0);
+        return true;
+    }
+
+    z_stream deflater;
+    z_stream inflater;
+    std::string pending;
+};
+
+#endif //RSHD_TRANSPORT_H
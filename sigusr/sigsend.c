@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/types.h>
+
+#define RT_SIGNALS 4 // real-time signals blocked by 'sigusr -f'
+#define END_SIGNAL (SIGRTMIN + RT_SIGNALS) // tells 'sigusr -f' how many signals were sent
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Retries while the receiver's queue is full.
+int queue_signal(pid_t pid, int sig, int payload, long *retries) {
+    union sigval value;
+    value.sival_int = payload;
+    while (sigqueue(pid, sig, value) == -1) {
+        if (errno != EAGAIN) {
+            fprintf(stderr, "Error during sigqueue(): %s\n", strerror(errno));
+            return -1;
+        }
+        (*retries)++;
+        sched_yield();
+    }
+    return 0;
+}
+
+// Sends <count> queued signals numbered from 0 to <pid> as fast as the queue allows,
+// then END_SIGNAL carrying <count> so the receiver can measure loss exactly.
+// Signal is SIGRTMIN+<rt> with <rt> in 0..RT_SIGNALS-1 (default 0), or SIGUSR1 when <rt> is "usr1", SIGUSR2 when "usr2".
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <pid> <count> [rt|usr1|usr2]\n", argv[0]);
+        return 1;
+    }
+    pid_t pid = (pid_t) atoi(argv[1]);
+    long count = atol(argv[2]);
+    int sig = SIGRTMIN;
+    if (argc > 3) {
+        if (strcmp(argv[3], "usr1") == 0) {
+            sig = SIGUSR1;
+        } else if (strcmp(argv[3], "usr2") == 0) {
+            sig = SIGUSR2;
+        } else {
+            char *end;
+            long rt = strtol(argv[3], &end, 10);
+            if (*argv[3] == '\0' || *end != '\0' || rt < 0 || rt >= RT_SIGNALS) {
+                fprintf(stderr, "Signal must be usr1, usr2 or 0..%d\n", RT_SIGNALS - 1);
+                return 1;
+            }
+            sig = SIGRTMIN + (int) rt;
+        }
+    }
+
+    long retries = 0;
+    double start = now();
+    for (long i = 0; i < count; i++) {
+        if (queue_signal(pid, sig, (int) i, &retries)) {
+            return 1;
+        }
+    }
+    double elapsed = now() - start;
+    if (queue_signal(pid, END_SIGNAL, (int) count, &retries)) {
+        return 1;
+    }
+
+    printf("Sent %ld signals in %.3f s", count, elapsed);
+    if (elapsed > 0) {
+        printf(", %.0f signals/s", count / elapsed);
+    }
+    printf(", %ld retries on full queue\n", retries);
+    return 0;
+}
@@ -7,10 +7,37 @@
 #include <string.h>
 #include <errno.h>
 #include <zconf.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/signalfd.h>
 
-int handled_signal = 0;
-int is_alarm = 0;
-pid_t cpid;
+#define TIMEOUT_SEC 10
+#define RT_SIGNALS 4
+#define END_SIGNAL (SIGRTMIN + RT_SIGNALS) // queued by sigsend after the blast, payload is the number sent
+#define MAX_SENDERS 64
+#define SIGINFO_BATCH 64
+
+volatile sig_atomic_t handled_signal = 0;
+volatile sig_atomic_t is_alarm = 0;
+volatile sig_atomic_t cpid;
+
+struct sender_stats {
+    pid_t pid;
+    long usr1;
+    long usr2;
+    long rt[RT_SIGNALS];
+    long total;
+    long expected; // highest payload + 1, the sender numbers its signals from 0
+    long sent; // reported by END_SIGNAL, 0 if it has not arrived
+    int last_payload;
+    double first_time;
+    double last_time;
+};
+
+struct sender_stats senders[MAX_SENDERS];
+int senders_num = 0;
+long other_signals = 0; // from senders that did not fit into senders
 
 void handler(int sig, siginfo_t *siginfo, void *_) {
     if (sig == SIGALRM) {
@@ -23,7 +50,150 @@ void handler(int sig, siginfo_t *siginfo, void *_) {
     }
 }
 
-int main() {
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct sender_stats *find_sender(pid_t pid) {
+    for (int i = 0; i < senders_num; i++) {
+        if (senders[i].pid == pid) {
+            return &senders[i];
+        }
+    }
+    if (senders_num == MAX_SENDERS) {
+        return NULL;
+    }
+    struct sender_stats *s = &senders[senders_num++];
+    memset(s, 0, sizeof(*s));
+    s->pid = pid;
+    return s;
+}
+
+void account(const struct signalfd_siginfo *info, double time) {
+    struct sender_stats *s = find_sender(info->ssi_pid);
+    if (info->ssi_signo == END_SIGNAL) {
+        if (s != NULL) {
+            s->sent = info->ssi_int;
+        }
+        return;
+    }
+    if (s == NULL) {
+        other_signals++;
+        return;
+    }
+    if (info->ssi_signo == SIGUSR1) {
+        s->usr1++;
+    } else if (info->ssi_signo == SIGUSR2) {
+        s->usr2++;
+    } else {
+        s->rt[info->ssi_signo - SIGRTMIN]++;
+    }
+    if (s->total == 0) {
+        s->first_time = time;
+    }
+    s->total++;
+    s->last_time = time;
+    if (info->ssi_code == SI_QUEUE) {
+        s->last_payload = info->ssi_int;
+        if (info->ssi_int >= s->expected) {
+            s->expected = (long) info->ssi_int + 1;
+        }
+    }
+}
+
+void report() {
+    if (senders_num == 0) {
+        printf("No signals were caught\n");
+        return;
+    }
+    for (int i = 0; i < senders_num; i++) {
+        struct sender_stats *s = &senders[i];
+        double elapsed = s->last_time - s->first_time;
+        printf("PID %d: %ld signals (SIGUSR1 %ld, SIGUSR2 %ld", s->pid, s->total, s->usr1, s->usr2);
+        for (int j = 0; j < RT_SIGNALS; j++) {
+            printf(", SIGRTMIN+%d %ld", j, s->rt[j]);
+        }
+        printf("), last payload %d", s->last_payload);
+        if (elapsed > 0) {
+            printf(", %.0f signals/s", s->total / elapsed);
+        }
+        // highest payload misses coalesced signals at the tail, prefer the count sigsend reported
+        long expected = s->sent > 0 ? s->sent : s->expected;
+        if (expected > 0) {
+            long lost = expected > s->total ? expected - s->total : 0;
+            printf(", lost %ld of %ld (%.2f%%)", lost, expected, 100.0 * lost / expected);
+        }
+        printf("\n");
+    }
+    if (other_signals != 0) {
+        printf("Other senders: %ld signals\n", other_signals);
+    }
+}
+
+// Counts every signal delivered through a signalfd until none arrive for TIMEOUT_SEC seconds.
+int run_signalfd() {
+    sigset_t mask;
+    if (sigemptyset(&mask) ||
+        sigaddset(&mask, SIGUSR1) ||
+        sigaddset(&mask, SIGUSR2)) {
+        fprintf(stderr, "Error during sigaddset(): %s\n", strerror(errno));
+        return 1;
+    }
+    for (int i = 0; i <= RT_SIGNALS; i++) { // SIGRTMIN+RT_SIGNALS is END_SIGNAL
+        if (sigaddset(&mask, SIGRTMIN + i)) {
+            fprintf(stderr, "Error during sigaddset(): %s\n", strerror(errno));
+            return 1;
+        }
+    }
+    if (sigprocmask(SIG_BLOCK, &mask, NULL)) {
+        fprintf(stderr, "Error during sigprocmask(): %s\n", strerror(errno));
+        return 1;
+    }
+    int sfd = signalfd(-1, &mask, 0);
+    if (sfd == -1) {
+        fprintf(stderr, "Error during signalfd(): %s\n", strerror(errno));
+        return 1;
+    }
+
+    struct pollfd pfd = {sfd, POLLIN, 0};
+    struct signalfd_siginfo infos[SIGINFO_BATCH];
+    while (1) {
+        int res = poll(&pfd, 1, TIMEOUT_SEC * 1000);
+        if (res == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Error during poll(): %s\n", strerror(errno));
+            break;
+        }
+        if (res == 0) {
+            break;
+        }
+        ssize_t bytes_read = read(sfd, infos, sizeof(infos));
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Error during read(): %s\n", strerror(errno));
+            break;
+        }
+        double time = now();
+        for (size_t i = 0; i < bytes_read / sizeof(struct signalfd_siginfo); i++) {
+            account(&infos[i], time);
+        }
+    }
+    close(sfd);
+    report();
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "-f") == 0) {
+        return run_signalfd();
+    }
+
     struct sigaction act;
     act.sa_flags = SA_SIGINFO;
     act.sa_sigaction = &handler;
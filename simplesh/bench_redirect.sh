@@ -0,0 +1,22 @@
+#!/usr/bin/env bash
+
+# Usage: bench_redirect.sh [size in MiB]
+# Times a bulk write through simplesh redirection against the same write through an extra pipe stage.
+
+SH=$(dirname "$0")/simplesh
+SIZE=${1:-256}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+head -c $((SIZE * 1024 * 1024)) /dev/zero > "$DIR/in"
+
+bench() {
+	local start=$(date '+%s%N')
+	echo "$2" | "$SH" > /dev/null
+	local ms=$((($(date '+%s%N') - start) / 1000000))
+	echo "$1: ${ms} ms, $((SIZE * 1000 / (ms > 0 ? ms : 1))) MiB/s"
+}
+
+bench "cat > file       " "cat $DIR/in > $DIR/out"
+bench "cat < file > file" "cat < $DIR/in > $DIR/out"
+bench "cat | tee file   " "cat $DIR/in | tee $DIR/out"
@@ -1,18 +1,53 @@
 #include <fcntl.h>
 #include <cstring>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/wait.h>
 #include <string>
 #include <vector>
+#include <deque>
 #include <sstream>
 
 using namespace std;
 
 const size_t BUF_MAX_SIZE = 1000;
+const size_t BULK_BUF_SIZE = 1 << 16;
+const size_t FAN_CHUNK_SIZE = 1 << 20;
+const size_t FAN_CHUNK_MAX = 2 * FAN_CHUNK_SIZE;
 const string ENV = "$ ";
 
 vector<pid_t> children;
 
+struct redirection {
+    int fd;
+    int flags;
+    string target;
+    bool here_string;
+};
+
+struct fan_worker {
+    pid_t pid;
+    int infd; // -1 once the whole chunk is written
+    int outfd; // -1 once the worker closed its output
+    string input;
+    size_t written;
+    string output;
+};
+
+// Input of a fan-out stage. Chunks are FAN_CHUNK_SIZE..FAN_CHUNK_MAX bytes and end on a line boundary
+// when there is one, every byte is scanned for newlines once per chunk.
+struct fan_input {
+    fan_input() : scanned(0), last_nl(string::npos) {}
+
+    size_t chunk_end(bool eof);
+
+    string take(size_t len);
+
+    string pending;
+    size_t scanned;
+    size_t last_nl;
+};
+
 
 void write_all(int fd, const char *buf, size_t len);
 
@@ -34,10 +69,21 @@ bool exec_commandpipe(const vector<string> &cpipe);
 
 bool exec_command(const string &command, int *infd, int *outfd);
 
-char **get_args(const string &command);
+char **get_args(const string &command, vector<redirection> &redirections);
+
+bool parse_redirection(const string &word, redirection &r);
+
+void apply_redirections(const vector<redirection> &redirections);
 
 void try_duplicate(int fd1, int fd2);
 
+bool parse_fan_out(const char *word, size_t &workers, bool &ordered);
+
+
+bool start_worker(char **args, string &&chunk, fan_worker &w);
+
+void fan_out(size_t workers_max, bool ordered, char **args);
+
 void check_sig_intr();
 
 bool sig_intr = false;
@@ -123,27 +169,267 @@ vector<string> &split(const string &s, char delimeter, vector<string> &res) {
     return res;
 }
 
-char **get_args(const string &command) {
+// Recognizes "<", ">", ">>", "2>" and "<<<" at the start of a word, the target is the rest of the word.
+bool parse_redirection(const string &word, redirection &r) {
+    const struct {
+        const char *op;
+        int fd;
+        int flags;
+        bool here_string;
+    } ops[] = {
+            {"<<<", STDIN_FILENO,  0,                                  true},
+            {"2>",  STDERR_FILENO, O_WRONLY | O_CREAT | O_TRUNC,       false},
+            {">>",  STDOUT_FILENO, O_WRONLY | O_CREAT | O_APPEND,      false},
+            {">",   STDOUT_FILENO, O_WRONLY | O_CREAT | O_TRUNC,       false},
+            {"<",   STDIN_FILENO,  O_RDONLY,                           false},
+    };
+    for (auto &op : ops) {
+        size_t len = strlen(op.op);
+        if (word.compare(0, len, op.op) == 0) {
+            r = {op.fd, op.flags, word.substr(len), op.here_string};
+            return true;
+        }
+    }
+    return false;
+}
+
+char **get_args(const string &command, vector<redirection> &redirections) {
     vector<string> words;
     split(command, ' ', words);
 
-    auto **args = new char *[words.size() + 1];
+    vector<string> argv;
     for (size_t i = 0; i < words.size(); i++) {
-        args[i] = new char[words[i].size()];
-        strcpy(args[i], words[i].c_str());
+        redirection r;
+        if (!parse_redirection(words[i], r)) {
+            argv.push_back(words[i]);
+            continue;
+        }
+        if (r.target.empty() && i + 1 < words.size()) {
+            r.target = words[++i];
+        }
+        redirections.push_back(r);
+    }
+
+    auto **args = new char *[argv.size() + 1];
+    for (size_t i = 0; i < argv.size(); i++) {
+        args[i] = new char[argv[i].size() + 1];
+        strcpy(args[i], argv[i].c_str());
     }
-    args[words.size()] = nullptr;
+    args[argv.size()] = nullptr;
     return args;
 }
 
+// Called in the child after the pipeline fds are in place, so redirections override them.
+void apply_redirections(const vector<redirection> &redirections) {
+    for (const redirection &r : redirections) {
+        int fd;
+        if (r.here_string) {
+            // an unlinked temp file, a pipe would block on strings larger than its capacity
+            char name[] = "/tmp/simplesh-XXXXXX";
+            check_error(fd = mkstemp(name), "mkstemp <-- <<<");
+            unlink(name);
+            write_all(fd, r.target + "\n");
+            check_error(lseek(fd, 0, SEEK_SET), "lseek <-- <<<");
+        } else {
+            while ((fd = open(r.target.c_str(), r.flags, 0644)) == -1) {
+                check_error(fd, "open <-- " + r.target);
+            }
+        }
+        try_duplicate(fd, r.fd);
+        try_close(fd);
+    }
+}
+
 void try_duplicate(int fd1, int fd2) {
     while (dup2(fd1, fd2) == -1) {
         check_error();
     }
 }
 
+// "@N" runs the stage as up to N parallel workers, "@Nu" does not keep the output order.
+bool parse_fan_out(const char *word, size_t &workers, bool &ordered) {
+    if (word == nullptr || word[0] != '@') {
+        return false;
+    }
+    char *end;
+    long n = strtol(word + 1, &end, 10);
+    if (end == word + 1 || n <= 0 || (*end != '\0' && strcmp(end, "u") != 0)) {
+        return false;
+    }
+    workers = (size_t) n;
+    ordered = *end == '\0';
+    return true;
+}
+
+// Length of the next chunk, 0 if not ready yet.
+size_t fan_input::chunk_end(bool eof) {
+    size_t limit = min(pending.size(), FAN_CHUNK_MAX);
+    if (scanned < limit) {
+        auto nl = (const char *) memrchr(pending.data() + scanned, '\n', limit - scanned);
+        if (nl != nullptr) {
+            last_nl = nl - pending.data();
+        }
+        scanned = limit;
+    }
+    if (last_nl != string::npos && last_nl + 1 >= FAN_CHUNK_SIZE) {
+        return last_nl + 1;
+    }
+    if (pending.size() >= FAN_CHUNK_MAX) {
+        return last_nl != string::npos ? last_nl + 1 : FAN_CHUNK_MAX;
+    }
+    return eof ? limit : 0;
+}
+
+string fan_input::take(size_t len) {
+    string chunk = pending.substr(0, len);
+    pending.erase(0, len);
+    scanned = 0;
+    last_nl = string::npos;
+    return chunk;
+}
+
+bool start_worker(char **args, string &&chunk, fan_worker &w) {
+    int in[2], out[2];
+    if (pipe2(in, O_CLOEXEC) == -1) {
+        return false;
+    }
+    if (pipe2(out, O_CLOEXEC) == -1) {
+        try_close(in[0]);
+        try_close(in[1]);
+        return false;
+    }
+    pid_t cpid = fork();
+    if (cpid == -1) {
+        try_close(in[0]);
+        try_close(in[1]);
+        try_close(out[0]);
+        try_close(out[1]);
+        return false;
+    }
+    if (cpid == 0) {
+        signal(SIGPIPE, SIG_DFL);
+        try_duplicate(in[0], STDIN_FILENO);
+        try_duplicate(out[1], STDOUT_FILENO);
+        execvp(args[0], const_cast<char* const*>(args));
+        check_error(-1, "execvp <-- " + string(args[0]));
+    }
+    try_close(in[0]);
+    try_close(out[1]);
+    fcntl(in[1], F_SETFL, O_NONBLOCK);
+    fcntl(out[0], F_SETFL, O_NONBLOCK);
+    w = {cpid, in[1], out[0], move(chunk), 0, {}};
+    return true;
+}
+
+// Runs in the stage process: splits stdin into line-aligned chunks and feeds each one
+// to a fresh worker, keeping at most workers_max of them running at once.
+void fan_out(size_t workers_max, bool ordered, char **args) {
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGCHLD, SIG_DFL);
+
+    deque<fan_worker> workers;
+    fan_input input;
+    bool eof = false;
+    vector<char> buffer(BULK_BUF_SIZE);
+    while (!eof || !input.pending.empty() || !workers.empty()) {
+        // the inherited signal_handler only raises sig_intr and interrupts poll, pass it on like an exec'd stage would die
+        if (sig_intr) {
+            for (fan_worker &w : workers) {
+                kill(w.pid, SIGINT);
+            }
+            for (fan_worker &w : workers) {
+                while (waitpid(w.pid, nullptr, 0) == -1 && errno == EINTR) {}
+            }
+            exit(EXIT_FAILURE);
+        }
+        size_t len;
+        while (workers.size() < workers_max && (len = input.chunk_end(eof)) != 0) {
+            fan_worker w;
+            if (!start_worker(args, input.take(len), w)) {
+                check_error(-1, "fork <-- " + string(args[0]));
+            }
+            workers.push_back(move(w));
+        }
+
+        vector<pollfd> fds;
+        bool want_input = !eof && input.chunk_end(false) == 0;
+        if (want_input) {
+            fds.push_back({STDIN_FILENO, POLLIN, 0});
+        }
+        for (fan_worker &w : workers) {
+            if (w.infd != -1) {
+                fds.push_back({w.infd, POLLOUT, 0});
+            }
+            if (w.outfd != -1) {
+                fds.push_back({w.outfd, POLLIN, 0});
+            }
+        }
+        if (!fds.empty() && poll(fds.data(), fds.size(), -1) == -1) {
+            check_error();
+            continue;
+        }
+
+        if (want_input && fds[0].revents != 0) {
+            ssize_t ssize = read(STDIN_FILENO, buffer.data(), BULK_BUF_SIZE);
+            if (ssize == -1) {
+                check_error();
+            } else if (ssize == 0) {
+                eof = true;
+            } else {
+                input.pending.append(buffer.data(), (size_t) ssize);
+            }
+        }
+        for (fan_worker &w : workers) {
+            if (w.infd != -1) {
+                ssize_t ssize = write(w.infd, w.input.data() + w.written, w.input.size() - w.written);
+                if (ssize != -1) {
+                    w.written += ssize;
+                } else if (errno != EAGAIN && errno != EINTR) {
+                    w.written = w.input.size(); // worker stopped reading its input
+                }
+                if (w.written == w.input.size()) {
+                    try_close(w.infd);
+                    w.infd = -1;
+                    string().swap(w.input);
+                }
+            }
+            if (w.outfd != -1) {
+                ssize_t ssize;
+                while ((ssize = read(w.outfd, buffer.data(), BULK_BUF_SIZE)) > 0) {
+                    w.output.append(buffer.data(), (size_t) ssize);
+                }
+                if (ssize == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    try_close(w.outfd);
+                    w.outfd = -1;
+                }
+            }
+        }
+
+        for (auto it = workers.begin(); it != workers.end();) {
+            bool done = it->infd == -1 && it->outfd == -1;
+            if (ordered && it != workers.begin()) {
+                break;
+            }
+            if (ordered || done) {
+                write_all(STDOUT_FILENO, it->output);
+                it->output.clear();
+            }
+            if (done) {
+                while (waitpid(it->pid, nullptr, 0) == -1 && errno == EINTR) {}
+                it = workers.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
 bool exec_command(const string &command, int *infd, int *outfd) {
-    char **args = get_args(command);
+    vector<redirection> redirections;
+    char **args = get_args(command, redirections);
+    size_t fan_workers = 0;
+    bool fan_ordered = true;
+    bool fan = parse_fan_out(args[0], fan_workers, fan_ordered) && args[1] != nullptr;
     pid_t cpid = fork();
     if (cpid == -1) {
         return false;
@@ -160,6 +446,11 @@ bool exec_command(const string &command, int *infd, int *outfd) {
             close_pipe(outfd);
         }
         close_pipe(firstfd);
+        apply_redirections(redirections);
+        if (fan) {
+            fan_out(fan_workers, fan_ordered, args + 1);
+            exit(EXIT_SUCCESS);
+        }
         execvp(args[0], const_cast<char* const*>(args));
     }
     children.push_back(cpid);
@@ -213,6 +504,7 @@ int main() {
     check_error(sigaction(SIGCHLD, &sa, nullptr), "sigaction <-- SIGCHLD");
 
     char buffer[BUF_MAX_SIZE];
+    vector<char> bulk_buffer(BULK_BUF_SIZE);
     ssize_t ssize = 0;
     size_t checked_symbols = 0;
     string command{};
@@ -250,7 +542,7 @@ int main() {
         if (success) {
             write_all(firstfd[1], tail);
             while (!(sig_intr || first_dead)) {
-                ssize = read(STDIN_FILENO, buffer, BUF_MAX_SIZE);
+                ssize = read(STDIN_FILENO, bulk_buffer.data(), BULK_BUF_SIZE);
                 if (ssize == -1) {
                     check_error();
                     continue;
@@ -259,7 +551,7 @@ int main() {
                     try_close(firstfd[1]);
                     break;
                 }
-                write_all(firstfd[1], buffer, (size_t) ssize);
+                write_all(firstfd[1], bulk_buffer.data(), (size_t) ssize);
             }
         }
         check_sig_intr();
@@ -280,12 +572,12 @@ int main() {
 
         if (success) {
             try_close(firstfd[1]);
-            while ((ssize = read(firstfd[0], buffer, BUF_MAX_SIZE)) != 0) {
+            while ((ssize = read(firstfd[0], bulk_buffer.data(), BULK_BUF_SIZE)) != 0) {
                 if (ssize == -1) {
                     check_error();
                     continue;
                 }
-                command += {buffer, (size_t) ssize};
+                command.append(bulk_buffer.data(), (size_t) ssize);
             }
             try_close(firstfd[0]);
             delete [] firstfd;